@@ -1,24 +1,34 @@
 #include "BasicMessagePassing.h"
+#include <chrono>
+#include <cmath>
 
 // init all data members
 BasicMessagePassing::BasicMessagePassing() {
-	created_msgs_head = NULL;
-	created_msgs_tail = NULL;
+	for (int g = 0; g < MAX_GENERATIONS; g++) {
+		created_msgs_head[g] = NULL;
+		created_msgs_tail[g] = NULL;
+		generation_epoch[g] = 0;
+	}
 
 	for (int i = 0; i < MAX_THREADS_POSSIBLE; i++) {
 		queues_head[i] = NULL;
 		queues_tail[i] = NULL;
 	}
+	latency_sample_period.store(0, std::memory_order_relaxed);
+	queues_trace.store(NULL, std::memory_order_relaxed);
 }
 
 // delete all items in all linked lists
 BasicMessagePassing::~BasicMessagePassing() {
 	message_t* nxt_msg;
-	message_t* at_msg = created_msgs_head;
-	while (at_msg!=NULL) {
-		nxt_msg = at_msg->next;
-		delete at_msg;
-		at_msg = nxt_msg;
+	message_t* at_msg;
+	for (int g = 0; g < MAX_GENERATIONS; g++) {
+		at_msg = created_msgs_head[g];
+		while (at_msg != NULL) {
+			nxt_msg = at_msg->next;
+			delete at_msg;
+			at_msg = nxt_msg;
+		}
 	}
 
 	message_wrapper* at_wrapper;
@@ -32,19 +42,28 @@ BasicMessagePassing::~BasicMessagePassing() {
 			at_wrapper = nxt_wrapper;
 		}
 	}
+
+	delete[] queues_trace.load(std::memory_order_relaxed);
 }
 
 /*
   Steps to creating a new message:
+   - Validate generation_id
    - Create a new message object
       - if bad_alloc error is caught, print err message and return NULL
    - intialize the data in the newly created message: 
       - len <= 0
 	  - data[MAX_DATA_LENTH] <= 00..
-   - add it to the created msgs linked list, will be used to keep track of all created messsages for the destructor to clear them
+   - add it to the created msgs linked list of its generation, will be used to keep track of all created messsages for the destructor to clear them
    - return the new message object address in memory
  */
-message_t* BasicMessagePassing::new_message() {
+message_t* BasicMessagePassing::new_message(uint8_t generation_id) {
+	if (generation_id >= MAX_GENERATIONS) {
+		std::cout << "!!ERR!! BasicMessagePassing::new_message received invalid generation id value: " << (int)generation_id << '\n';
+		std::cout << "        valid values of generation id : [0 - " << MAX_GENERATIONS << " - 1]\n";
+		return NULL;
+	}
+
 	message_t* new_msg;
 	try {
 		new_msg = new message_t;
@@ -62,19 +81,21 @@ message_t* BasicMessagePassing::new_message() {
 	for (int i = 0; i < MAX_DATA_LENTH; i++) {
 		new_msg->data[i] = 0;
 	}
+	new_msg->generation = generation_id;
 	new_msg->next = NULL;
 
 	//  - add it to the linked list
 	{
 		std::lock_guard<std::mutex> lg_msgs(m_msgs);
 
-		if (created_msgs_head == NULL) {		// Linked list of created messages is empty
-			created_msgs_head = new_msg;
-			created_msgs_tail = new_msg;
+		new_msg->epoch = generation_epoch[generation_id];
+		if (created_msgs_head[generation_id] == NULL) {		// Linked list of created messages is empty
+			created_msgs_head[generation_id] = new_msg;
+			created_msgs_tail[generation_id] = new_msg;
 		}
 		else {
-			created_msgs_tail->next = new_msg;
-			created_msgs_tail = new_msg;
+			created_msgs_tail[generation_id]->next = new_msg;
+			created_msgs_tail[generation_id] = new_msg;
 		}
 	}
 
@@ -84,7 +105,7 @@ message_t* BasicMessagePassing::new_message() {
 /*
   Steps to deleting a message:
    - Find all wrapper messages in the MAX_THREADS_POSSIBLE queues pointing to the msg and delete the wrappers from the Linekd List
-   - Find the msg in the linked list of created message objects, and delete it from the Linked List
+   - Find the msg in the linked list of created message objects of its generation, and delete it from the Linked List
 */
 void BasicMessagePassing::delete_message(message_t* msg) {
 	if (msg == NULL) {
@@ -127,16 +148,18 @@ void BasicMessagePassing::delete_message(message_t* msg) {
 	// then delete the msg object from its linked list
 	message_t* at_msg; 
 	message_t* prev_msg = NULL;
+	uint8_t gen = msg->generation;
 	{
 		std::lock_guard<std::mutex> lg_msgs(m_msgs);
-		at_msg = created_msgs_head;
+		at_msg = created_msgs_head[gen];
 		while (at_msg != NULL){
 			if (at_msg == msg) { // There will only be one object in this linked list 
 				if (prev_msg == NULL) { // delete the first element of the linked list
-					created_msgs_head = at_msg->next;
+					created_msgs_head[gen] = at_msg->next;
+					if (created_msgs_head[gen] == NULL) created_msgs_tail[gen] = NULL;
 				}
 				else if (at_msg->next == NULL) { // delete the last element of the linked list
-					created_msgs_tail = prev_msg;
+					created_msgs_tail[gen] = prev_msg;
 					prev_msg->next = NULL;
 				}
 				else	// delete a middle node in the linked list,
@@ -151,11 +174,71 @@ void BasicMessagePassing::delete_message(message_t* msg) {
 	delete msg;
 }
 
+/*
+  Steps to releasing a generation of messages:
+   - Validate inputs
+   - Detach the generation linked list of created messages and advance the generation epoch,
+      so messages created in the generation while it's being released are tagged with the new epoch and kept
+   - Walk each of the MAX_THREADS_POSSIBLE queues once, deleting all wrappers pointing to a message of the generation and the released epoch
+   - Delete all messages in the detached linked list
+*/
+int BasicMessagePassing::release_generation(uint8_t generation_id) {
+	if (generation_id >= MAX_GENERATIONS) {
+		std::cout << "!!ERR!! BasicMessagePassing::release_generation received invalid generation id value: " << (int)generation_id << '\n';
+		std::cout << "        valid values of generation id : [0 - " << MAX_GENERATIONS << " - 1]\n";
+		return INVALID_GENERATION_ID;
+	}
+
+	message_t* released_head;
+	uint32_t released_epoch;
+	{
+		std::lock_guard<std::mutex> lg_msgs(m_msgs);
+		released_head = created_msgs_head[generation_id];
+		created_msgs_head[generation_id] = NULL;
+		created_msgs_tail[generation_id] = NULL;
+		released_epoch = generation_epoch[generation_id]++;
+	}
+	if (released_head == NULL) return SUCCESS;	// Nothing created in this generation
+
+	message_wrapper* at_wrapper;
+	message_wrapper* prev_wrapper;
+	message_wrapper* to_delete_wrapper;
+	for (int i = 0; i < MAX_THREADS_POSSIBLE; i++) {
+		std::lock_guard<std::mutex> lg_queue(m_queue[i]);
+		at_wrapper = queues_head[i];
+		prev_wrapper = NULL;
+		while (at_wrapper != NULL) {
+			if (at_wrapper->msg->generation == generation_id && at_wrapper->msg->epoch == released_epoch) {
+				to_delete_wrapper = at_wrapper;
+				at_wrapper = at_wrapper->next;
+				if (prev_wrapper == NULL) queues_head[i] = at_wrapper;
+				else prev_wrapper->next = at_wrapper;
+				delete to_delete_wrapper;
+			}
+			else {
+				prev_wrapper = at_wrapper;
+				at_wrapper = at_wrapper->next;
+			}
+		}
+		queues_tail[i] = prev_wrapper;	// last kept wrapper, NULL if the queue is now empty
+	}
+
+	message_t* nxt_msg;
+	message_t* at_msg = released_head;
+	while (at_msg != NULL) {
+		nxt_msg = at_msg->next;
+		delete at_msg;
+		at_msg = nxt_msg;
+	}
+
+	return SUCCESS;
+}
+
 /*
   Steps to send a message:
  - Validate inputs
  - Creates a new message wrapper in the queue for thread_id,
-     init new wrapper members
+     init new wrapper members, stamp it with the send time when it's sampled for latency tracing
  - Update the corresponding linked list 
 */
 int BasicMessagePassing::send(uint8_t destination_id, message_t* msg) {
@@ -181,10 +264,19 @@ int BasicMessagePassing::send(uint8_t destination_id, message_t* msg) {
 	}
 	//new_wrapper->dst = destination_id;
 	new_wrapper->msg = msg;
+	new_wrapper->enqueue_ns = 0;
 	new_wrapper->next = NULL;
+	bool sampled = false;
+	uint32_t sample_period = latency_sample_period.load(std::memory_order_relaxed);
+	queue_trace_t* trace = sample_period != 0 ? queues_trace.load(std::memory_order_acquire) : NULL;
+	if (trace != NULL) { // trace 1 of every sample_period sends
+		uint32_t sample_count = trace[destination_id].sample_counter.fetch_add(1, std::memory_order_relaxed) + 1;
+		sampled = (sample_count % sample_period == 0);
+	}
 
 	{
 		std::lock_guard<std::mutex> lg_queue(m_queue[destination_id]);
+		if (sampled) new_wrapper->enqueue_ns = steady_clock_ns();	// stamped at enqueue, so the time spent waiting for the queue lock is not counted as residency
 		if (queues_head[destination_id] == NULL) { // first message in an empty queue
 			queues_head[destination_id] = new_wrapper;
 			queues_tail[destination_id] = new_wrapper;  // add to empty linked list 
@@ -227,8 +319,132 @@ int BasicMessagePassing::recv(uint8_t receiver_id, message_t*& msg) {
 		}
 	}
 
+	if (to_del->enqueue_ns != 0) { // sampled send, record its queue residency. The tracing state exists since the send was sampled
+		uint64_t now_ns = steady_clock_ns();
+		uint64_t latency_ns = now_ns > to_del->enqueue_ns ? now_ns - to_del->enqueue_ns : 0;
+		queue_trace_t* trace = queues_trace.load(std::memory_order_acquire);
+		trace[receiver_id].hist[latency_bucket_index(latency_ns)].fetch_add(1, std::memory_order_relaxed);
+	}
+
 	msg = to_del->msg;
 	delete to_del;
 
 	return SUCCESS;
+}
+
+/*
+  Steps to set latency tracing:
+ - When tracing is enabled for the first time, allocate and clear the tracing state of all queues,
+	if another thread allocated it concurrently, keep theirs and delete ours
+ - Update the sampling period
+*/
+int BasicMessagePassing::set_latency_tracing(uint32_t sample_period) {
+	if (sample_period != 0 && queues_trace.load(std::memory_order_acquire) == NULL) {
+		queue_trace_t* new_trace;
+		try {
+			new_trace = new queue_trace_t[MAX_THREADS_POSSIBLE];
+		}
+		catch (const std::bad_alloc& e) {
+			std::cout << "!!ERR!! BasicMessagePassing::set_latency_tracing while creating the latency histograms\n";
+			std::cout << e.what() << std::endl;
+			return ERROR_ALLOCATING_DYN_MEM;
+		}
+		for (int i = 0; i < MAX_THREADS_POSSIBLE; i++) {
+			new_trace[i].sample_counter.store(0, std::memory_order_relaxed);
+			for (int b = 0; b < LATENCY_HIST_BUCKETS; b++) {
+				new_trace[i].hist[b].store(0, std::memory_order_relaxed);
+			}
+		}
+
+		queue_trace_t* expected = NULL;
+		if (!queues_trace.compare_exchange_strong(expected, new_trace, std::memory_order_acq_rel)) {
+			delete[] new_trace;
+		}
+	}
+
+	latency_sample_period.store(sample_period, std::memory_order_relaxed);
+	return SUCCESS;
+}
+
+/*
+  Steps to read a latency histogram:
+ - Validate inputs
+ - Copy each bucket counter, exchanging it with 0 when a reset is requested, and sum the total
+	all buckets are 0 when tracing was never enabled
+*/
+int BasicMessagePassing::get_latency_histogram(uint8_t destination_id, latency_histogram_t* hist, bool reset) {
+	if (destination_id >= MAX_THREADS_POSSIBLE) {
+		std::cout << "!!ERR!! BasicMessagePassing::get_latency_histogram received invalid destination id value: " << (int)destination_id << '\n';
+		std::cout << "        valid values of destination id : [0 - " << MAX_THREADS_POSSIBLE << " - 1]\n";
+		return INVALID_DESTINATION_ID;
+	}
+
+	if (hist == NULL) {
+		std::cout << "!!ERR!! BasicMessagePassing::get_latency_histogram received invalid histogram address == NULL\n";
+		return INVALID_HISTOGRAM_ADDRESS;
+	}
+
+	queue_trace_t* trace = queues_trace.load(std::memory_order_acquire);
+	hist->total = 0;
+	for (int b = 0; b < LATENCY_HIST_BUCKETS; b++) {
+		if (trace == NULL) hist->count[b] = 0;
+		else if (reset) hist->count[b] = trace[destination_id].hist[b].exchange(0, std::memory_order_relaxed);
+		else hist->count[b] = trace[destination_id].hist[b].load(std::memory_order_relaxed);
+		hist->total += hist->count[b];
+	}
+
+	return SUCCESS;
+}
+
+/*
+  Bucket layout:
+ - latencies below LATENCY_HIST_SUB_BUCKETS ns get one bucket each
+ - every larger power of 2 magnitude is split into LATENCY_HIST_SUB_BUCKETS linear sub buckets,
+	i.e. the bucket width is at most 1/LATENCY_HIST_SUB_BUCKETS of the latency it counts
+*/
+int BasicMessagePassing::latency_bucket_index(uint64_t latency_ns) {
+	if (latency_ns < LATENCY_HIST_SUB_BUCKETS) return (int)latency_ns;
+
+	int magnitude = 63;
+	while ((latency_ns >> magnitude) == 0) magnitude--;
+	if (magnitude > LATENCY_HIST_MAX_MAGNITUDE) return LATENCY_HIST_BUCKETS - 1;
+
+	int sub_bucket = (int)(latency_ns >> (magnitude - LATENCY_HIST_SUB_BUCKET_BITS)) & (LATENCY_HIST_SUB_BUCKETS - 1);
+	return (magnitude - LATENCY_HIST_SUB_BUCKET_BITS + 1) * LATENCY_HIST_SUB_BUCKETS + sub_bucket;
+}
+
+uint64_t BasicMessagePassing::latency_bucket_value(int bucket) {
+	if (bucket < 0) return 0;
+	if (bucket >= LATENCY_HIST_BUCKETS) bucket = LATENCY_HIST_BUCKETS - 1;
+	if (bucket < LATENCY_HIST_SUB_BUCKETS) return (uint64_t)bucket;
+
+	int magnitude = bucket / LATENCY_HIST_SUB_BUCKETS + LATENCY_HIST_SUB_BUCKET_BITS - 1;
+	uint64_t sub_bucket = bucket % LATENCY_HIST_SUB_BUCKETS;
+	return ((uint64_t)LATENCY_HIST_SUB_BUCKETS + sub_bucket) << (magnitude - LATENCY_HIST_SUB_BUCKET_BITS);
+}
+
+// The highest latency of a bucket is one below the lowest latency of the next bucket
+uint64_t BasicMessagePassing::latency_bucket_highest_value(int bucket) {
+	if (bucket < 0) return 0;
+	if (bucket >= LATENCY_HIST_BUCKETS - 1) return UINT64_MAX;
+	return latency_bucket_value(bucket + 1) - 1;
+}
+
+uint64_t BasicMessagePassing::latency_percentile(const latency_histogram_t* hist, double percentile) {
+	if (hist == NULL || hist->total == 0) return 0;
+
+	if (percentile < 0) percentile = 0;
+	if (percentile > 100) percentile = 100;
+	uint64_t target = (uint64_t)std::ceil(percentile / 100.0 * (double)hist->total);	// rank of the receive the percentile falls on
+	if (target < 1) target = 1;
+	uint64_t seen = 0;
+	for (int b = 0; b < LATENCY_HIST_BUCKETS; b++) {
+		seen += hist->count[b];
+		if (seen >= target) return latency_bucket_highest_value(b);
+	}
+	return latency_bucket_highest_value(LATENCY_HIST_BUCKETS - 1);
+}
+
+uint64_t BasicMessagePassing::steady_clock_ns() {
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
 }
\ No newline at end of file
@@ -3,16 +3,33 @@
 #include <cstdlib>
 #include <iostream>
 #include <mutex> 
+#include <atomic>
 
 #define MAX_THREADS_POSSIBLE 32				// Assuming this library is designed for an embedded system with a limited number of hardware_concurrency support 
 #define MAX_DATA_LENTH 255
+#define MAX_GENERATIONS 16					// Number of message generations (arenas) that can be released in bulk, generation 0 is the default
+
+// Queue residency latency histogram, HDR style: log2 magnitude buckets, each split into 2^LATENCY_HIST_SUB_BUCKET_BITS linear sub buckets
+#define LATENCY_HIST_SUB_BUCKET_BITS 3
+#define LATENCY_HIST_SUB_BUCKETS (1 << LATENCY_HIST_SUB_BUCKET_BITS)
+#define LATENCY_HIST_MAX_MAGNITUDE 40		// Highest magnitude with its own sub buckets, latencies of 2^41 ns (~36 minutes) or longer are counted in the last bucket
+#define LATENCY_HIST_BUCKETS ((LATENCY_HIST_MAX_MAGNITUDE - LATENCY_HIST_SUB_BUCKET_BITS + 2) * LATENCY_HIST_SUB_BUCKETS)
+#define CACHE_LINE_SIZE 64					// Used to keep per queue counters written by different threads on separate cache lines
 
 typedef struct message_t {
 	uint8_t len;
 	uint8_t data[MAX_DATA_LENTH];
+	uint8_t generation;						// Set by new_message, not to be modified by the user
+	uint32_t epoch;							// Number of times its generation was released before it was created, set by new_message
 	struct message_t* next;
 };
 
+// Snapshot of the queue residency latency histogram of one destination queue, as returned by get_latency_histogram
+struct latency_histogram_t {
+	uint64_t count[LATENCY_HIST_BUCKETS];	// Number of sampled receives per bucket, use latency_bucket_value / latency_bucket_highest_value to get the bucket latency range
+	uint64_t total;							// Sum of all bucket counts
+};
+
 class BasicMessagePassing{
 public:
 	enum erorrIds {
@@ -21,7 +38,9 @@ public:
 		INVALID_DESTINATION_ID,
 		INVALID_RECEIVER_ID,
 		ERROR_ALLOCATING_DYN_MEM,
-		THREAD_QUEUE_EMPTY
+		THREAD_QUEUE_EMPTY,
+		INVALID_GENERATION_ID,
+		INVALID_HISTOGRAM_ADDRESS
 	};
 
 	/*
@@ -37,15 +56,17 @@ public:
 	~BasicMessagePassing();
 
 	/*
-	* 	new_message() 
-	*		creates a new message_t object in Heap
+	* 	new_message(uint8_t generation_id) 
+	*		creates a new message_t object in Heap, and adds it to the generation_id linked list
 	*   Input: 
-	*		None
+	*		uint8_t		generation_id	: optional, defaults to generation 0
 	*   Retrun:
 	* 		address of newly created object in heap if creation was successful
-	* 		or NULL when error is encountered
+	* 		or NULL when error is encountered (including an out of range generation_id)
+	*	Assumptions:
+	*		The generation ID has to be within the acceptable range [0 - MAX_GENERATIONS - 1]
 	*/
-	message_t* new_message();
+	message_t* new_message(uint8_t generation_id = 0);
 	
 	/*	
 	*	void delete_message(message_t* msg) 
@@ -64,6 +85,24 @@ public:
 	*/
 	void delete_message(message_t* msg);
 
+	/*
+	*	int release_generation(uint8_t generation_id)
+	*		deletes all messages created in generation_id, and all their send message requests that have not been received
+	*	Input:
+	*		uint8_t		generation_id
+	*	Return:
+	*		0 on success
+	*		Error code otherwise	{INVALID_GENERATION_ID}
+	*	Assumptions:
+	*		Each queue is walked only once, regardless of the number of messages in the generation,
+	*		instead of calling delete_message for every message.
+	*		Only messages created before the call are released; messages created in the generation and sent by
+	*		other threads while it is being released are kept along with their sends.
+	*		The released messages are not to be sent, received or deleted by other threads while they are being released.
+	*		The generation can be reused for new messages after it is released.
+	*/
+	int release_generation(uint8_t generation_id);
+
 	/*
 	*	int send(uint8_t destination_id, message_t* msg)
 	*		Create a send message object with a pointer to the desired message, add it to destination ID FIFO
@@ -95,18 +134,82 @@ public:
 	*/
 	int recv(uint8_t receiver_id, message_t*& msg);
 
+	/*
+	*	int set_latency_tracing(uint32_t sample_period)
+	*		Enable or disable tracing of how long sent messages wait in the destination queue before being received
+	*	Input:
+	*		uint32_t	sample_period	: 0 disables tracing (default), N traces one of every N sends to each destination queue
+	*	Return:
+	*		0 on success
+	*		Error code otherwise	{ERROR_ALLOCATING_DYN_MEM}
+	*	Assumptions:
+	*		The histograms (MAX_THREADS_POSSIBLE * LATENCY_HIST_BUCKETS counters, ~80 KB) are allocated from the heap the first
+	*		time tracing is enabled, and kept until the object is destroyed. Instances that never trace don't pay for them.
+	*		Sampled sends are stamped with steady_clock at enqueue time, recv records the residency in the
+	*		destination histogram without taking any lock. Sends queued before tracing was enabled are not recorded.
+	*/
+	int set_latency_tracing(uint32_t sample_period);
+
+	/*
+	*	int get_latency_histogram(uint8_t destination_id, latency_histogram_t* hist, bool reset)
+	*		Copy the queue residency latency histogram of a destination queue, and optionally reset it
+	*	Input:
+	*		uint8_t					destination_id
+	*		latency_histogram_t*	hist	: snapshot of the histogram is written here
+	*		bool					reset	: clear the histogram buckets while copying them
+	*	Return:
+	*		0 on success
+	*		Error code otherwise	{INVALID_DESTINATION_ID, INVALID_HISTOGRAM_ADDRESS}
+	*	Assumptions:
+	*		Receives recorded while the histogram is being copied are counted either in this snapshot or the next one.
+	*/
+	int get_latency_histogram(uint8_t destination_id, latency_histogram_t* hist, bool reset = false);
+
+	/*
+	*	static uint64_t latency_bucket_value(int bucket)
+	*		Lowest latency in ns counted in a histogram bucket
+	*/
+	static uint64_t latency_bucket_value(int bucket);
+
+	/*
+	*	static uint64_t latency_bucket_highest_value(int bucket)
+	*		Highest latency in ns counted in a histogram bucket, UINT64_MAX for the last bucket since it counts all longer latencies
+	*/
+	static uint64_t latency_bucket_highest_value(int bucket);
+
+	/*
+	*	static uint64_t latency_percentile(const latency_histogram_t* hist, double percentile)
+	*		Latency in ns at or below which the given percentile [0 - 100] of the histogram receives fall,
+	*		i.e. the highest latency of the bucket the percentile falls in. Returns 0 for an empty histogram.
+	*/
+	static uint64_t latency_percentile(const latency_histogram_t* hist, double percentile);
+
 private:
 	// Linked List wrapper object for Send commands.
 	typedef struct  message_wrapper {
 		message_t* msg;
 		//uint8_t dst;
+		uint64_t enqueue_ns;	// steady_clock time of the send, 0 when the send is not sampled for latency tracing
 		struct message_wrapper* next;
 	};
+
+	// Latency tracing state of a queue. The sampling counter is on its own cache line so producers
+	// sending to different destinations, and receivers updating the histogram, don't contend on it
+	struct alignas(CACHE_LINE_SIZE) queue_trace_t {
+		std::atomic<uint32_t> sample_counter;
+		alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> hist[LATENCY_HIST_BUCKETS];
+	};
+
+	// Map a latency in ns to its histogram bucket
+	static int latency_bucket_index(uint64_t latency_ns);
+	static uint64_t steady_clock_ns();
 	
 
-	// Linked List of all created messages, used for deleting all created messages in destructor
-	message_t* created_msgs_head;
-	message_t* created_msgs_tail;
+	// Linked Lists of all created messages per generation, used for deleting all created messages in destructor and release_generation
+	message_t* created_msgs_head[MAX_GENERATIONS];
+	message_t* created_msgs_tail[MAX_GENERATIONS];
+	// Release count of each generation, protected by m_msgs. Tells apart released messages from ones created during the release
+	uint32_t generation_epoch[MAX_GENERATIONS];
 
 	// Linked List Fifo Queues for all possible thread_ids in the rang [0-MAX_THREADS_POSSIBLE]
 	message_wrapper* queues_head[MAX_THREADS_POSSIBLE];
@@ -115,4 +218,9 @@ private:
 	// Synchronization mutexes 
 	std::mutex m_msgs;
 	std::mutex m_queue[MAX_THREADS_POSSIBLE];
+
+	// Latency tracing: sampling period (0 = disabled), and the lock-free tracing state of all MAX_THREADS_POSSIBLE queues,
+	// NULL until tracing is first enabled
+	std::atomic<uint32_t> latency_sample_period;
+	std::atomic<queue_trace_t*> queues_trace;
 };
@@ -94,6 +94,12 @@ void Test3ProducerTh(BasicMessagePassing* bmp);
 // Joinable thread, to be able to stop it remotely with a stop_token
 void Test3ConsumerTh(std::stop_token st, BasicMessagePassing* bmp, uint8_t thread_id); // waits for available messages passed to thread_id
 
+// Test 4: Bulk release of a generation of messages, and their pending sends
+void Test4GenerationTh(BasicMessagePassing* bmp);
+
+// Test 5: Queue residency latency tracing, sampling and histograms
+void Test5LatencyTracingTh(BasicMessagePassing* bmp);
+
 
 int main(){
     BasicMessagePassing * p_basic_message_passing_uut;
@@ -134,6 +140,20 @@ int main(){
     cont_consumer1.join();
 
 
+    std::cout << "Test group 4: a thread creates messages in 2 generations, sends them, then releases one generation in bulk" << std::endl;
+    p_basic_message_passing_uut = new BasicMessagePassing();
+    std::thread generation_thread(Test4GenerationTh, p_basic_message_passing_uut);
+    generation_thread.join();
+    delete p_basic_message_passing_uut;
+
+
+    std::cout << "Test group 5: a thread sends and receives messages with latency tracing enabled, and checks the residency histograms" << std::endl;
+    p_basic_message_passing_uut = new BasicMessagePassing();
+    std::thread tracing_thread(Test5LatencyTracingTh, p_basic_message_passing_uut);
+    tracing_thread.join();
+    delete p_basic_message_passing_uut;
+
+
     std::cout << "Test program completed execution sucessfully." << std::endl;
     std::cout << "Unless a failed assertion is encountered, the test results matched expectations." << std::endl;
     return 0;
@@ -338,3 +358,126 @@ void Test3ConsumerTh(std::stop_token st, BasicMessagePassing* bmp, uint8_t threa
         }
     }
 }
+
+#define GENERATION_MSG_COUNT 1000
+void Test4GenerationTh(BasicMessagePassing* bmp) {
+    int status;
+    message_t* msg;
+    message_t* kept_msg = bmp->new_message(2);
+    assert(kept_msg != NULL);
+    assert(kept_msg->generation == 2);
+
+    std::lock_guard<std::mutex> lg_cout(m_cout);    // to be kept for the duration of the generation test
+    std::cout << "              - new_message(MAX_GENERATIONS) - should display err message and return NULL" << std::endl;
+    msg = bmp->new_message(MAX_GENERATIONS);
+    assert(msg == NULL);
+    std::cout << "              - release_generation(MAX_GENERATIONS) - should return INVALID_GENERATION_ID" << std::endl;
+    status = bmp->release_generation(MAX_GENERATIONS);
+    assert(status == BasicMessagePassing::INVALID_GENERATION_ID);
+
+    std::cout << "              - create " << GENERATION_MSG_COUNT << " messages in generation 1, interleave their sends to threads 3 and 4 with sends of a generation 2 message" << std::endl;
+    bmp->send(3, kept_msg);
+    for (int i = 0; i < GENERATION_MSG_COUNT; i++) {
+        msg = bmp->new_message(1);
+        assert(msg != NULL);
+        status = bmp->send(3, msg);
+        assert(status == BasicMessagePassing::SUCCESS);
+        status = bmp->send(4, msg);
+        assert(status == BasicMessagePassing::SUCCESS);
+    }
+    bmp->send(4, kept_msg);
+    bmp->send(3, kept_msg);
+
+    std::cout << "              - release_generation(1) - only the generation 2 message sends should remain in the queues" << std::endl;
+    status = bmp->release_generation(1);
+    assert(status == BasicMessagePassing::SUCCESS);
+    for (int i = 0; i < 2; i++) {
+        status = bmp->recv(3, msg);
+        assert(status == BasicMessagePassing::SUCCESS && msg == kept_msg);
+    }
+    status = bmp->recv(4, msg);
+    assert(status == BasicMessagePassing::SUCCESS && msg == kept_msg);
+    std::cout << "              - recv(3, msg), recv(4, msg) - should return THREAD_QUEUE_EMPTY" << std::endl;
+    status = bmp->recv(3, msg);
+    assert(status == BasicMessagePassing::THREAD_QUEUE_EMPTY);
+    status = bmp->recv(4, msg);
+    assert(status == BasicMessagePassing::THREAD_QUEUE_EMPTY);
+
+    std::cout << "              - generation 1 can be reused after it's released, and sends to a released queue tail are queued" << std::endl;
+    msg = bmp->new_message(1);
+    assert(msg != NULL && msg->epoch == 1);
+    bmp->send(4, msg);
+    status = bmp->recv(4, msg);
+    assert(status == BasicMessagePassing::SUCCESS && msg->generation == 1);
+    status = bmp->release_generation(1);
+    assert(status == BasicMessagePassing::SUCCESS);
+    bmp->delete_message(kept_msg);
+}
+
+#define TRACED_SEND_COUNT 100
+#define TRACED_RESIDENCY_MS 10
+void Test5LatencyTracingTh(BasicMessagePassing* bmp) {
+    int status;
+    message_t* msg = bmp->new_message();
+    latency_histogram_t* hist = new latency_histogram_t;
+
+    std::lock_guard<std::mutex> lg_cout(m_cout);    // to be kept for the duration of the latency tracing test
+    std::cout << "              - get_latency_histogram(MAX_THREADS_POSSIBLE, hist) - should return INVALID_DESTINATION_ID" << std::endl;
+    status = bmp->get_latency_histogram(MAX_THREADS_POSSIBLE, hist);
+    assert(status == BasicMessagePassing::INVALID_DESTINATION_ID);
+    std::cout << "              - get_latency_histogram(5, NULL) - should return INVALID_HISTOGRAM_ADDRESS" << std::endl;
+    status = bmp->get_latency_histogram(5, NULL);
+    assert(status == BasicMessagePassing::INVALID_HISTOGRAM_ADDRESS);
+
+    std::cout << "              - tracing disabled: " << TRACED_SEND_COUNT << " sends and receives to thread 5 should not be recorded" << std::endl;
+    for (int i = 0; i < TRACED_SEND_COUNT; i++) bmp->send(5, msg);
+    for (int i = 0; i < TRACED_SEND_COUNT; i++) bmp->recv(5, msg);
+    status = bmp->get_latency_histogram(5, hist);
+    assert(status == BasicMessagePassing::SUCCESS && hist->total == 0);
+
+    std::cout << "              - tracing every send: messages held " << TRACED_RESIDENCY_MS << " ms in the queue should be recorded with at least that latency" << std::endl;
+    status = bmp->set_latency_tracing(1);
+    assert(status == BasicMessagePassing::SUCCESS);
+    for (int i = 0; i < TRACED_SEND_COUNT; i++) bmp->send(5, msg);
+    std::this_thread::sleep_for(std::chrono::milliseconds(TRACED_RESIDENCY_MS));
+    for (int i = 0; i < TRACED_SEND_COUNT; i++) bmp->recv(5, msg);
+    status = bmp->get_latency_histogram(5, hist, true);
+    assert(status == BasicMessagePassing::SUCCESS && hist->total == TRACED_SEND_COUNT);
+    assert(BasicMessagePassing::latency_percentile(hist, 0) >= TRACED_RESIDENCY_MS * 1000000ull);
+    std::cout << "                p50 latency: " << BasicMessagePassing::latency_percentile(hist, 50) << " ns, p99 latency: " << BasicMessagePassing::latency_percentile(hist, 99) << " ns" << std::endl;
+    status = bmp->get_latency_histogram(5, hist);
+    assert(status == BasicMessagePassing::SUCCESS && hist->total == 0);
+
+    std::cout << "              - tracing 1 in 4 sends: only a quarter of the receives should be recorded" << std::endl;
+    status = bmp->set_latency_tracing(4);
+    assert(status == BasicMessagePassing::SUCCESS);
+    for (int i = 0; i < TRACED_SEND_COUNT; i++) bmp->send(5, msg);
+    for (int i = 0; i < TRACED_SEND_COUNT; i++) bmp->recv(5, msg);
+    status = bmp->get_latency_histogram(5, hist);
+    assert(status == BasicMessagePassing::SUCCESS && hist->total == TRACED_SEND_COUNT / 4);
+    status = bmp->get_latency_histogram(6, hist);
+    assert(status == BasicMessagePassing::SUCCESS && hist->total == 0);
+
+    std::cout << "              - latency_percentile of hand built histograms - should report the highest latency of the bucket reaching the percentile" << std::endl;
+    for (int b = 0; b < LATENCY_HIST_BUCKETS; b++) hist->count[b] = 0;
+    hist->count[1] = 1;
+    hist->count[2] = 1;
+    hist->count[3] = 1;
+    hist->total = 3;
+    assert(BasicMessagePassing::latency_percentile(hist, -5) == 1);
+    assert(BasicMessagePassing::latency_percentile(hist, 33) == 1);
+    assert(BasicMessagePassing::latency_percentile(hist, 40) == 2);
+    assert(BasicMessagePassing::latency_percentile(hist, 49) == 2);
+    assert(BasicMessagePassing::latency_percentile(hist, 100) == 3);
+    assert(BasicMessagePassing::latency_percentile(hist, 150) == 3);
+    for (int b = 0; b < LATENCY_HIST_BUCKETS; b++) hist->count[b] = 0;
+    hist->count[1] = 99;
+    hist->count[200] = 1;
+    hist->total = 100;
+    assert(BasicMessagePassing::latency_percentile(hist, 99) == 1);
+    assert(BasicMessagePassing::latency_percentile(hist, 99.4) == BasicMessagePassing::latency_bucket_highest_value(200));
+
+    bmp->set_latency_tracing(0);
+    bmp->delete_message(msg);
+    delete hist;
+}